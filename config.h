@@ -75,4 +75,34 @@ const unsigned long MIN_IR_BREAK = 5UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)
 const unsigned long SOLENOID_DURATION = 40UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));       // duration of solenoid valve release
 const unsigned long LED_BLINK_INTERVAL = 500UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1)));     // led blink on interval
 
+/*
+ * Idle mode
+ * sleep (SLEEP_MODE_IDLE, AVR only) at the end of loop() when no output is active and no detection is pending,
+ * wakes on pin change of the IR, touch and INPUT_TRIGGER pins or on the timer0 tick (~1.024ms) that drives millis()/micros()
+ * duty cycle and edge-to-processed response latency are reported over serial as I<awake permille>,<wakes>,<edge wakes>,<mean latency us>,<max latency us>
+ * after runtime end without input trigger the board stays in power down instead of spinning
+ * preprocessor switch (0/1) so that the pin change ISRs are only linked in when used, e.g. not alongside SoftwareSerial
+ */
+#define IDLE_MODE 0
+const unsigned long IDLE_GUARD = 1100UL * TIME_IN_MICROSECONDS;                                   // skip sleep if a deadline is due within this time, covers one timer0 tick in micros mode
+const unsigned long IDLE_REPORT_INTERVAL = 60UL * 1000UL * (1 + (TIME_IN_MICROSECONDS * (1000 - 1))); // interval between idle reports, keep below ~70min
+
+/*
+ * Raw input trace
+ * logs the raw reads seen by detectIR/detectTouch, before persistance/edge logic, for bit exact replay with host/trace_replay
+ * snapshot bits : 0-IR A, 1-touch A, 2-IR B, 3-touch B (logic corrected), printed as one hex digit
+ * T<snapshot>                       : detector reads before the first traced loop()
+ * R<snapshot><dt>[x<n>][g<lag>]     : reads changed, one of the first three iterations with unchanged reads (all detectIR can tell apart)
+ *                                     moved to a new time tick, or the loop skipped a time tick while an IR persistance check was
+ *                                     pending (millis() itself skips ~23 ticks/s, not logged with settled IR), dt after the previous record,
+ *                                     n loop() iterations at that time (default 1), previous iteration lag before it (default 1, 0 if dt is 0)
+ * Z<dt>                             : trace end before E, last traced loop() iteration dt after the previous record
+ * O<dt>                             : serial TX buffer short of RAW_TRACE_TX_RESERVE, the trace stops instead of blocking loop(),
+ *                                     last traced loop() iteration dt after the previous record
+ * each run of unchanged reads costs one line, raise BAUD_RATE if the IR flickers at a high rate (about 100 runs/s at 9600 baud)
+ * every iteration becomes a record with TIME_IN_MICROSECONDS since loop() does not run on every microsecond
+ */
+const bool RAW_TRACE = false;
+const int RAW_TRACE_TX_RESERVE = 40;                                                              // free serial TX buffer bytes (63 on AVR) needed to log a record, longest record is 29, the rest is kept for events
+
 #endif
\ No newline at end of file
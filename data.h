@@ -26,6 +26,23 @@ struct TTLState
 	unsigned long pulsePeriod;
 };
 
+struct RawTraceState
+{
+	bool enabled;
+	bool started;
+	bool pending;
+	bool overflow;
+	bool settled;
+	byte snapshot;
+	byte lastSnapshot;
+	byte runLength;
+	byte count;
+	unsigned long dt;
+	unsigned long lag;
+	unsigned long tRecord;
+	unsigned long tLast;
+};
+
 struct RuntimeState
 {
 	byte led_pin;
@@ -39,6 +56,7 @@ struct RuntimeState
 	unsigned long delay;
 	TTLState* inputTrigger;
 	TTLState* outputTrigger;
+	RawTraceState* rawTrace;
 };
 
 struct BlinkLEDState
@@ -95,6 +113,22 @@ struct SolenoidState
 	TTLState* outputTrigger;
 };
 
+struct IdleState
+{
+	bool enabled;
+	bool edgeWake;
+	unsigned long wakeCount;
+	unsigned long edgeWakeCount;
+	unsigned long tEdge;
+	unsigned long sleepDuration;
+	unsigned long latencySum;
+	unsigned long latencyMax;
+	unsigned long latencyCount;
+	unsigned long tReportStart;
+	unsigned long tReport;
+	unsigned long reportInterval;
+};
+
 struct LinearActuatorState
 {
 	byte pin;
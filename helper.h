@@ -8,6 +8,11 @@
 #include "data.h"
 #include "config.h"
 
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+
 void eventLog(byte side, 
               byte type, 
               byte state, 
@@ -222,17 +227,225 @@ bool detectTTL(TTLState *ttlState,
   }
 }
 
+inline bool settledIR(IRState &irDetector)
+{
+  /*
+  <IRState> irDetector : struct storing irDetector state parameters
+
+  Returns:
+  <bool> : true if reads and break state agree, i.e. no persistance check is pending in detectIR
+  */
+  return irDetector.currentRead == irDetector.lastRead &&
+         irDetector.lastRead == irDetector.inBreak &&
+         irDetector.inBreak == irDetector.breakEvent;
+}
+
+inline byte rawSnapshot(IRState &irDetectorA,
+                        TouchState &touchSensorA,
+                        IRState &irDetectorB,
+                        TouchState &touchSensorB)
+{
+  /*
+  Pack the latest raw reads of all detectors, call right after detectIR/detectTouch
+
+  Returns:
+  <byte> : bit 0-IR A, 1-touch A, 2-IR B, 3-touch B
+  */
+  return irDetectorA.currentRead |
+         (touchSensorA.last << 1) |
+         (irDetectorB.currentRead << 2) |
+         (touchSensorB.last << 3);
+}
+
+void initRawTrace(RawTraceState &rawTrace,
+                  byte snapshot,
+                  bool enabled = RAW_TRACE)
+{
+  /*
+  Initialize raw input trace and log the detector reads it starts from
+  <RawTraceState> rawTrace : struct storing the raw trace run being recorded
+  <byte> snapshot : rawSnapshot() of the freshly initialized detectors
+  <bool> enabled : set true to log the raw trace, defaults to RAW_TRACE
+  */
+  rawTrace.enabled = enabled;
+  rawTrace.started = false;
+  rawTrace.pending = false;
+  rawTrace.overflow = false;
+  rawTrace.settled = false;
+  rawTrace.snapshot = snapshot;
+  rawTrace.lastSnapshot = snapshot;
+  rawTrace.runLength = 0;
+  rawTrace.count = 0;
+  rawTrace.dt = 0;
+  rawTrace.lag = 0;
+  rawTrace.tRecord = 0;
+  rawTrace.tLast = 0;
+  if (rawTrace.enabled)
+  {
+    // log
+    Serial.print('T');
+    Serial.println(snapshot, HEX);
+  }
+}
+
+bool logRawTrace(RawTraceState &rawTrace,
+                 bool wait = false)
+{
+  /*
+  Serial print the pending run record, optional fields only when they differ from their defaults
+    If the serial TX buffer is short of RAW_TRACE_TX_RESERVE the record is dropped and the trace overflows,
+    printing would block loop() and shift every later timestamp.
+  <RawTraceState> rawTrace : struct storing the raw trace run being recorded
+  <bool> wait : print regardless of the TX buffer, blocking until there is room
+
+  Returns:
+  <bool> : false if the record was dropped
+  */
+  if (!wait && Serial.availableForWrite() < RAW_TRACE_TX_RESERVE)
+  {
+    // reads are known up to the iteration before the dropped record
+    rawTrace.overflow = true;
+    rawTrace.pending = false;
+    rawTrace.tLast = rawTrace.tRecord - rawTrace.lag;
+    rawTrace.tRecord -= rawTrace.dt;
+    return false;
+  }
+  Serial.print('R');
+  Serial.print(rawTrace.snapshot, HEX);
+  Serial.print(rawTrace.dt);
+  if (rawTrace.count != 1)
+  {
+    Serial.print('x');
+    Serial.print(rawTrace.count);
+  }
+  if (rawTrace.lag != (rawTrace.dt > 0 ? 1UL : 0UL))
+  {
+    Serial.print('g');
+    Serial.print(rawTrace.lag);
+  }
+  Serial.println();
+  rawTrace.pending = false;
+  return true;
+}
+
+void logRawTraceEnd(RawTraceState &rawTrace,
+                    char marker)
+{
+  /*
+  Serial print the time of the last traced iteration relative to the last record
+  <char> marker : 'Z' at runtime end, 'O' after an overflow
+  */
+  Serial.print(marker);
+  Serial.println(rawTrace.tLast - rawTrace.tRecord);
+}
+
+void updateRawTrace(RawTraceState &rawTrace,
+                    byte snapshot,
+                    bool settled,
+                    unsigned long tNow)
+{
+  /*
+  Run length encode the raw reads of every loop() iteration
+    A record starts whenever the reads change, one of the first three iterations with unchanged reads falls on a
+    new tick - detectIR looks back two reads, so only these can differ in outcome - or the loop skipped a time tick
+    while an IR persistance check was pending. Touch detection is edge only and settled IR has no time dependent
+    branch, so skipped ticks are not logged otherwise, AVR millis() skips a value ~23 times/s by design.
+    Iterations at the first tick of a record are counted and the record is logged once time moves on. In between
+    records the replay runs the loop once on every tick, which is all detection can observe.
+
+  <RawTraceState> rawTrace : struct storing the raw trace run being recorded
+  <byte> snapshot : rawSnapshot() of this iteration
+  <bool> settled : settledIR() of both IR detectors after this iteration
+  <unsigned long> tNow : current time of execution
+  */
+  if (!rawTrace.enabled)
+  {
+    return;
+  }
+  if (rawTrace.overflow)
+  {
+    // the trace cannot be replayed past the dropped record, log where it stopped once there is room
+    if (Serial.availableForWrite() >= RAW_TRACE_TX_RESERVE)
+    {
+      logRawTraceEnd(rawTrace, 'O');
+      rawTrace.enabled = false;
+    }
+    return;
+  }
+  if (rawTrace.pending && tNow == rawTrace.tRecord && snapshot == rawTrace.snapshot)
+  {
+    if (rawTrace.count < 255)
+    {
+      rawTrace.count++;
+    }
+    if (rawTrace.runLength < 3)
+    {
+      rawTrace.runLength++;
+    }
+    return;
+  }
+  if (rawTrace.pending && !logRawTrace(rawTrace))
+  {
+    return;
+  }
+  if (snapshot != rawTrace.lastSnapshot)
+  {
+    rawTrace.runLength = 0;
+  }
+  // skipped ticks lie before this iteration, what matters is the state the previous one left
+  if (!rawTrace.started || rawTrace.runLength < 3 || (tNow - rawTrace.tLast > 1 && !rawTrace.settled))
+  {
+    rawTrace.pending = true;
+    rawTrace.snapshot = snapshot;
+    rawTrace.count = 1;
+    rawTrace.dt = tNow - rawTrace.tRecord;
+    rawTrace.lag = rawTrace.started ? tNow - rawTrace.tLast : 0;
+    rawTrace.tRecord = tNow;
+    rawTrace.started = true;
+  }
+  if (rawTrace.runLength < 3)
+  {
+    rawTrace.runLength++;
+  }
+  rawTrace.lastSnapshot = snapshot;
+  rawTrace.settled = settled;
+  rawTrace.tLast = tNow;
+}
+
+void endRawTrace(RawTraceState &rawTrace)
+{
+  /*
+  Complete the trace before runtime end is logged, the last traced iteration can be well before E if loop() stalled
+    Logs the pending record and Z, or O if the trace overflowed earlier in the session, the trace then stays off.
+    Runtime end is printed with a blocking write right after, so the pending record waits for the serial TX buffer
+    instead of being dropped.
+  <RawTraceState> rawTrace : struct storing the raw trace run being recorded
+  */
+  if (!rawTrace.enabled || !rawTrace.started)
+  {
+    return;
+  }
+  if (rawTrace.pending)
+  {
+    logRawTrace(rawTrace, true);
+  }
+  logRawTraceEnd(rawTrace, rawTrace.overflow ? 'O' : 'Z');
+  rawTrace.enabled = !rawTrace.overflow;
+}
+
 void initRuntime(RuntimeState &runtimeState,
                  byte pin, TTLState* outputTrigger,
                  TTLState* inputTrigger = nullptr,
                  unsigned long duration = RUN_TIME_DURATION,
-                 unsigned long delay = DELAY_START)
+                 unsigned long delay = DELAY_START,
+                 RawTraceState* rawTrace = nullptr)
 {
   /*
   Initialize default state variable for runtime
   <struct RuntimeState> runtimeState : runtime struct variable
   <byte> pin : led indicator pin for runtime - HIGH when on, LOW when off
   <unsigned long> duration : set total duration for runtime execution, defaults to RUN_TIME_DURATION
+  <RawTraceState*> rawTrace : raw input trace to complete before runtime end is logged
   */
   pinMode(pin, OUTPUT);
   runtimeState.led_pin  = pin;
@@ -244,6 +457,7 @@ void initRuntime(RuntimeState &runtimeState,
   runtimeState.tLast = -1;
   runtimeState.inputTrigger = inputTrigger;
   runtimeState.outputTrigger = outputTrigger;
+  runtimeState.rawTrace = rawTrace;
 }
 
 void updateRuntime(RuntimeState &runtimeState)
@@ -262,11 +476,25 @@ void updateRuntime(RuntimeState &runtimeState)
       digitalWriteCorrected(SOLENOID_A_PIN, OFF, SOLENOID_ACTIVE_LOW);
       digitalWriteCorrected(SOLENOID_B_PIN, OFF, SOLENOID_ACTIVE_LOW);
       runtimeState.runtimeFlag = false;
+      if (runtimeState.rawTrace != nullptr)
+      {
+        endRawTrace(*runtimeState.rawTrace);
+      }
       // log
       Serial.print('E');
       Serial.println(runtimeState.tNow);
 
+#if IDLE_MODE && defined(__AVR__)
+      // nothing is left to run, stay in power down instead of spinning, the log is sent out first
+      Serial.flush();
+      set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+      while (true)
+      {
+        sleep_mode();
+      }
+#else
       while (true);
+#endif
     }
     //start condition
     if (!runtimeState.runtimeFlag && runtimeState.tNow - runtimeState.tStart >= DELAY_START)
@@ -289,6 +517,10 @@ void updateRuntime(RuntimeState &runtimeState)
       digitalWriteCorrected(SOLENOID_B_PIN, OFF, SOLENOID_ACTIVE_LOW);
       runtimeState.runtimeFlag = false;
       sendTTL(runtimeState.outputTrigger, runtimeState.tNow);
+      if (runtimeState.rawTrace != nullptr)
+      {
+        endRawTrace(*runtimeState.rawTrace);
+      }
       // log
       Serial.print('E');
       Serial.println(runtimeState.tNow);
@@ -551,4 +783,194 @@ void updateSolenoid(SolenoidState &solenoidValve,
   }
 }
 
+volatile bool idleEdgePending = false;
+volatile unsigned long tIdleEdge = 0;
+
+#if IDLE_MODE && defined(__AVR__) && defined(PCINT0_vect)
+ISR(PCINT0_vect)
+{
+  // first unprocessed edge only, cleared by updateIdle
+  if (!idleEdgePending)
+  {
+    tIdleEdge = micros();
+    idleEdgePending = true;
+  }
+}
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect));
+#endif
+#endif
+
+bool enableWakeOnEdge(byte pin)
+{
+  /*
+  Enable pin change interrupt on an input pin to wake from idle sleep
+  <byte> pin : digital pin ID
+
+  Returns:
+  <bool> : false if the pin has no pin change interrupt, the board is not AVR based or IDLE_MODE is 0
+  */
+#if IDLE_MODE && defined(__AVR__) && defined(PCINT0_vect)
+  volatile uint8_t* pcicr = digitalPinToPCICR(pin);
+  if (pcicr == 0)
+  {
+    return false;
+  }
+  *digitalPinToPCMSK(pin) |= bit(digitalPinToPCMSKbit(pin));
+  PCIFR |= bit(digitalPinToPCICRbit(pin));
+  *pcicr |= bit(digitalPinToPCICRbit(pin));
+  return true;
+#else
+  (void)pin;
+  return false;
+#endif
+}
+
+void initIdle(IdleState &idleState,
+              bool enabled = IDLE_MODE,
+              unsigned long reportInterval = IDLE_REPORT_INTERVAL)
+{
+  /*
+  Initialize idle mode and enable wake on edge for all detection inputs
+  <IdleState> idleState : struct storing idle mode state and duty cycle/latency statistics
+  <bool> enabled : set true to sleep in between loop() iterations, defaults to IDLE_MODE
+  <unsigned long> reportInterval : interval between serial idle reports
+  */
+  idleState.enabled = false;
+  if (enabled)
+  {
+    idleState.enabled = enableWakeOnEdge(IR_A_PIN) &&
+                        enableWakeOnEdge(TOUCH_A_PIN) &&
+                        enableWakeOnEdge(IR_B_PIN) &&
+                        enableWakeOnEdge(TOUCH_B_PIN) &&
+                        enableWakeOnEdge(INPUT_TRIGGER);
+    if (!idleState.enabled)
+    {
+      // log
+      Serial.println("Idle mode unavailable: no pin change interrupt on all inputs or IDLE_MODE not compiled in");
+    }
+  }
+  idleState.edgeWake = false;
+  idleState.wakeCount = 0;
+  idleState.edgeWakeCount = 0;
+  idleState.tEdge = 0;
+  idleState.sleepDuration = 0;
+  idleState.latencySum = 0;
+  idleState.latencyMax = 0;
+  idleState.latencyCount = 0;
+  idleState.tReportStart = micros();
+  idleState.tReport = currentTime(-1);
+  idleState.reportInterval = reportInterval;
+}
+
+inline unsigned long timeRemaining(unsigned long tSince,
+                                   unsigned long duration,
+                                   unsigned long tNow)
+{
+  /*
+  <unsigned long> tSince : start of the timed interval
+  <unsigned long> duration : interval duration
+  <unsigned long> tNow : current time
+
+  Returns:
+  <unsigned long> : time left until tSince + duration, 0 if already due
+  */
+  unsigned long elapsed = tNow - tSince;
+  return elapsed >= duration ? 0 : duration - elapsed;
+}
+
+void updateIdle(IdleState &idleState,
+                unsigned long tNow,
+                bool busy,
+                unsigned long tDeadline)
+{
+  /*
+  Call at the end of loop() - sleeps until the next pin change or timer0 tick if nothing is pending
+    SLEEP_MODE_IDLE keeps timer0 and the UART running, so millis()/micros() and serial logging are unaffected.
+    Response latency is measured from the pin change ISR to the end of the loop() iteration that processed it.
+
+  <IdleState> idleState : struct storing idle mode state and statistics
+  <unsigned long> tNow : current time
+  <bool> busy : true if an output is active or detection is pending
+  <unsigned long> tDeadline : time left until the next scheduled deadline
+  */
+  if (!idleState.enabled)
+  {
+    return;
+  }
+#if defined(__AVR__)
+  if (idleState.edgeWake)
+  {
+    unsigned long latency = micros() - idleState.tEdge;
+    idleState.latencySum += latency;
+    idleState.latencyCount++;
+    if (latency > idleState.latencyMax)
+    {
+      idleState.latencyMax = latency;
+    }
+    idleState.edgeWake = false;
+  }
+
+  noInterrupts();
+  bool edge = idleEdgePending;
+  idleEdgePending = false;
+  interrupts();
+
+  if (!edge && !busy && tDeadline >= IDLE_GUARD)
+  {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    noInterrupts();
+    if (!idleEdgePending)
+    {
+      unsigned long tSleep = micros();
+      sleep_enable();
+      interrupts();
+      sleep_cpu();
+      sleep_disable();
+      idleState.sleepDuration += micros() - tSleep;
+      idleState.wakeCount++;
+      noInterrupts();
+      if (idleEdgePending)
+      {
+        idleState.edgeWake = true;
+        idleState.tEdge = tIdleEdge;
+        idleState.edgeWakeCount++;
+      }
+    }
+    interrupts();
+  }
+#else
+  (void)busy;
+  (void)tDeadline;
+#endif
+
+  if (tNow - idleState.tReport >= idleState.reportInterval)
+  {
+    unsigned long elapsed = micros() - idleState.tReportStart;
+    unsigned long awake = elapsed >= 1000UL ? 1000UL - min(1000UL, idleState.sleepDuration / (elapsed / 1000UL)) : 1000UL;
+    // log
+    Serial.print('I');
+    Serial.print(awake);
+    Serial.print(',');
+    Serial.print(idleState.wakeCount);
+    Serial.print(',');
+    Serial.print(idleState.edgeWakeCount);
+    Serial.print(',');
+    Serial.print(idleState.latencyCount ? idleState.latencySum / idleState.latencyCount : 0UL);
+    Serial.print(',');
+    Serial.println(idleState.latencyMax);
+    idleState.wakeCount = 0;
+    idleState.edgeWakeCount = 0;
+    idleState.sleepDuration = 0;
+    idleState.latencySum = 0;
+    idleState.latencyMax = 0;
+    idleState.latencyCount = 0;
+    idleState.tReportStart = micros();
+    idleState.tReport = tNow;
+  }
+}
+
 #endif
\ No newline at end of file
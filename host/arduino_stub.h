@@ -0,0 +1,101 @@
+/*
+ * Host stand-ins for the Arduino core functions used by helper.h
+ *   Pins are plain memory that the host tool sets before calling into helper.h, Serial output is
+ *   collected in a string instead of being sent. Host tools pass time into helper.h explicitly, the clock
+ *   functions only exist so that helper.h compiles.
+ */
+
+#ifndef HOST_ARDUINO_STUB
+#define HOST_ARDUINO_STUB
+
+#include <string>
+
+#include "host_arduino.h"
+
+const byte LOW = 0;
+const byte HIGH = 1;
+const byte INPUT = 0;
+const byte OUTPUT = 1;
+const byte INPUT_PULLUP = 2;
+const int DEC = 10;
+const int HEX = 16;
+const byte STUB_PIN_COUNT = 20;
+
+inline bool stubPinLevel[STUB_PIN_COUNT];
+
+inline void pinMode(byte, byte)
+{
+}
+
+inline int digitalRead(byte pin)
+{
+  return pin < STUB_PIN_COUNT ? stubPinLevel[pin] : LOW;
+}
+
+inline void digitalWrite(byte pin, int v)
+{
+  if (pin < STUB_PIN_COUNT)
+  {
+    stubPinLevel[pin] = v;
+  }
+}
+
+inline unsigned long micros()
+{
+  return 0;
+}
+
+inline unsigned long millis()
+{
+  return 0;
+}
+
+template <typename T>
+inline T min(T a, T b)
+{
+  return b < a ? b : a;
+}
+
+struct StubSerial
+{
+  std::string out;
+  int room = 63;   // free TX buffer bytes reported to availableForWrite(), AVR default buffer
+
+  int availableForWrite() { return room; }
+
+  void print(const char* s) { out += s; }
+  void print(char c) { out += c; }
+  void print(int v, int base = DEC) { print((long)v, base); }
+  void print(unsigned int v, int base = DEC) { print((unsigned long)v, base); }
+  void print(long v, int base = DEC)
+  {
+    if (v < 0)
+    {
+      out += '-';
+      print((unsigned long)-v, base);
+      return;
+    }
+    print((unsigned long)v, base);
+  }
+  void print(unsigned long v, int base = DEC)
+  {
+    char buf[8 * sizeof(unsigned long) + 1];
+    char* p = buf + sizeof(buf);
+    do
+    {
+      unsigned long d = v % base;
+      *--p = d < 10 ? '0' + d : 'A' + d - 10;
+      v /= base;
+    } while (v > 0);
+    out.append(p, buf + sizeof(buf) - p);
+  }
+  void println() { out += "\r\n"; }
+  template <typename T>
+  void println(T v) { print(v); println(); }
+  template <typename T>
+  void println(T v, int base) { print(v, base); println(); }
+};
+
+inline StubSerial Serial;
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Host-side decoding of the serial event stream written by eventLog() and updateRuntime()
+ *   <side><type><state><t> : sensor/actuator event, one digit per identifier as defined under config.h
+ *   S<t>                   : runtime start
+ *   E<t>                   : runtime end
+ *   I<a>,<w>,<e>,<l>,<m>   : idle report from updateIdle(), awake permille, wakes, edge wakes, mean/max latency in us
+ *   T<s> / R<s><dt>[x<n>][g<lag>] : raw input trace from initRawTrace()/updateRawTrace(), see config.h
+ *   Z<dt> / O<dt>          : raw input trace end at runtime end / after a serial TX buffer overflow
+ *   Linear Track ...       : banner printed from setup(), i.e. the board was reset
+ */
+
+#ifndef HOST_EVENT_STREAM
+#define HOST_EVENT_STREAM
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "host_arduino.h"
+#include "../config.h"
+
+const size_t STREAM_LINE_MAX = 64;
+const size_t IDLE_REPORT_FIELDS = 5;
+
+enum LineKind
+{
+  LINE_EVENT,
+  LINE_START,
+  LINE_END,
+  LINE_IDLE,
+  LINE_BANNER,
+  LINE_OTHER,
+  // append new kinds here, host tools may keep LineKind values around
+  LINE_TRACE_INIT,
+  LINE_TRACE,
+  LINE_TRACE_END,
+  LINE_TRACE_OVERFLOW,
+};
+
+struct StreamLine
+{
+  LineKind kind;
+  byte side;
+  byte type;
+  byte state;
+  uint32_t t;
+  uint32_t idle[IDLE_REPORT_FIELDS];
+  byte snapshot;
+  uint32_t count;
+  uint32_t lag;
+};
+
+struct LineDecoder
+{
+  char buf[STREAM_LINE_MAX];
+  size_t len;
+  bool overflow;
+  unsigned long long lines;
+  unsigned long long badLines;
+};
+
+inline bool parseTime(const char* s, size_t n, uint32_t &t)
+{
+  /*
+  Parse an unsigned decimal device timestamp
+  <const char*> s : first digit
+  <size_t> n : number of characters
+  <uint32_t> t : parsed time, device unsigned long is 32 bit
+
+  Returns:
+  <bool> : true if s holds only digits and fits into 32 bits
+  */
+  if (n == 0 || n > 10)
+  {
+    return false;
+  }
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    if (s[i] < '0' || s[i] > '9')
+    {
+      return false;
+    }
+    v = v * 10 + (s[i] - '0');
+  }
+  if (v > UINT32_MAX)
+  {
+    return false;
+  }
+  t = (uint32_t)v;
+  return true;
+}
+
+inline int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+inline LineKind parseStreamLine(const char* s, size_t n, StreamLine &line)
+{
+  /*
+  Decode a single line of the event stream, without line terminator
+  <const char*> s : line start
+  <size_t> n : line length
+  <StreamLine> line : decoded line, fields other than kind are only valid for the kind that uses them
+
+  Returns:
+  <LineKind> : decoded line kind, LINE_OTHER if the line does not match any known format
+  */
+  line.kind = LINE_OTHER;
+  if (n == 0)
+  {
+    return line.kind;
+  }
+  if (s[0] == 'S' || s[0] == 'E')
+  {
+    if (parseTime(s + 1, n - 1, line.t))
+    {
+      line.kind = s[0] == 'S' ? LINE_START : LINE_END;
+    }
+    return line.kind;
+  }
+  if (s[0] == 'Z' || s[0] == 'O')
+  {
+    if (parseTime(s + 1, n - 1, line.t))
+    {
+      line.kind = s[0] == 'Z' ? LINE_TRACE_END : LINE_TRACE_OVERFLOW;
+    }
+    return line.kind;
+  }
+  if (s[0] == 'I')
+  {
+    size_t start = 1;
+    size_t field = 0;
+    for (size_t i = 1; i <= n && field < IDLE_REPORT_FIELDS; i++)
+    {
+      if (i == n || s[i] == ',')
+      {
+        if (!parseTime(s + start, i - start, line.idle[field]))
+        {
+          return line.kind;
+        }
+        field++;
+        start = i + 1;
+      }
+    }
+    if (field == IDLE_REPORT_FIELDS && start == n + 1)
+    {
+      line.kind = LINE_IDLE;
+    }
+    return line.kind;
+  }
+  if ((s[0] == 'T' || s[0] == 'R') && n >= 2)
+  {
+    int snapshot = hexDigit(s[1]);
+    if (snapshot < 0)
+    {
+      return line.kind;
+    }
+    line.snapshot = snapshot;
+    if (s[0] == 'T')
+    {
+      line.kind = n == 2 ? LINE_TRACE_INIT : LINE_OTHER;
+      return line.kind;
+    }
+    // R<s><dt>[x<n>][g<lag>]
+    size_t end = 2;
+    while (end < n && s[end] != 'x' && s[end] != 'g')
+    {
+      end++;
+    }
+    if (!parseTime(s + 2, end - 2, line.t))
+    {
+      return line.kind;
+    }
+    line.count = 1;
+    line.lag = line.t > 0 ? 1 : 0;
+    if (end < n && s[end] == 'x')
+    {
+      size_t start = ++end;
+      while (end < n && s[end] != 'g')
+      {
+        end++;
+      }
+      if (!parseTime(s + start, end - start, line.count) || line.count == 0)
+      {
+        return line.kind;
+      }
+    }
+    if (end < n && s[end] == 'g')
+    {
+      if (!parseTime(s + end + 1, n - end - 1, line.lag))
+      {
+        return line.kind;
+      }
+      end = n;
+    }
+    if (end == n)
+    {
+      line.kind = LINE_TRACE;
+    }
+    return line.kind;
+  }
+  if (n > 3 && s[0] >= '0' && s[0] <= '9')
+  {
+    byte side = s[0] - '0';
+    byte type = s[1] - '0';
+    byte state = s[2] - '0';
+    if ((side == SIDE_A || side == SIDE_B) &&
+        (type == IR || type == TOUCH || type == SOLENOID) &&
+        (state == OFF || state == ON) &&
+        parseTime(s + 3, n - 3, line.t))
+    {
+      line.side = side;
+      line.type = type;
+      line.state = state;
+      line.kind = LINE_EVENT;
+    }
+    return line.kind;
+  }
+  if (n >= 12 && memcmp(s, "Linear Track", 12) == 0)
+  {
+    line.kind = LINE_BANNER;
+  }
+  return line.kind;
+}
+
+inline void initLineDecoder(LineDecoder &decoder)
+{
+  decoder.len = 0;
+  decoder.overflow = false;
+  decoder.lines = 0;
+  decoder.badLines = 0;
+}
+
+template <typename OnLine>
+void decodeStream(LineDecoder &decoder,
+                  const char* data,
+                  size_t n,
+                  OnLine onLine)
+{
+  /*
+  Feed raw bytes from the serial port, calling onLine(const StreamLine&) for every complete line
+    Lines are terminated by '\n' with an optional '\r' (Serial.println), partial lines are carried over
+    to the next call. Lines longer than STREAM_LINE_MAX are dropped and counted as bad lines.
+
+  <LineDecoder> decoder : decoder state
+  <const char*> data : received bytes
+  <size_t> n : number of received bytes
+  <OnLine> onLine : callback for each decoded line
+  */
+  StreamLine line;
+  for (size_t i = 0; i < n; i++)
+  {
+    char c = data[i];
+    if (c == '\n')
+    {
+      size_t len = decoder.len;
+      if (len > 0 && decoder.buf[len - 1] == '\r')
+      {
+        len--;
+      }
+      if (!decoder.overflow && len > 0)
+      {
+        decoder.lines++;
+        if (parseStreamLine(decoder.buf, len, line) == LINE_OTHER)
+        {
+          decoder.badLines++;
+        }
+        onLine(line);
+      }
+      else if (decoder.overflow)
+      {
+        decoder.lines++;
+        decoder.badLines++;
+      }
+      decoder.len = 0;
+      decoder.overflow = false;
+    }
+    else if (decoder.len < STREAM_LINE_MAX)
+    {
+      decoder.buf[decoder.len++] = c;
+    }
+    else
+    {
+      decoder.overflow = true;
+    }
+  }
+}
+
+inline speed_t baudToSpeed(unsigned long baud)
+{
+  switch (baud)
+  {
+    case 9600UL: return B9600;
+    case 19200UL: return B19200;
+    case 38400UL: return B38400;
+    case 57600UL: return B57600;
+    case 115200UL: return B115200;
+    case 230400UL: return B230400;
+    case 460800UL: return B460800;
+    case 921600UL: return B921600;
+    case 1000000UL: return B1000000;
+    case 2000000UL: return B2000000;
+    default: return B0;
+  }
+}
+
+inline int openSerialDevice(const char* path,
+                            unsigned long baud = BAUD_RATE)
+{
+  /*
+  Open a serial device or pty for non-blocking reads in raw mode
+  <const char*> path : device path, e.g. /dev/ttyACM0 or /dev/pts/3
+  <unsigned long> baud : line rate, defaults to BAUD_RATE from config.h
+
+  Returns:
+  <int> : file descriptor, -1 on failure with errno set
+  */
+  speed_t speed = baudToSpeed(baud);
+  if (speed == B0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  int fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  if (isatty(fd))
+  {
+    termios tio;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    // VMIN 0 would make read() return 0 instead of EAGAIN when no data is buffered
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+      int err = errno;
+      close(fd);
+      errno = err;
+      return -1;
+    }
+  }
+  return fd;
+}
+
+inline uint64_t monotonicNs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,21 @@
+/*
+ * Minimal Arduino definitions so that the sketch headers (config.h, data.h)
+ * can be included by the host-side tools under host/
+ */
+
+#ifndef HOST_ARDUINO
+#define HOST_ARDUINO
+
+#include <cstdint>
+
+typedef uint8_t byte;
+
+/*Analog pin aliases as numbered on the Arduino Uno*/
+const byte A0 = 14;
+const byte A1 = 15;
+const byte A2 = 16;
+const byte A3 = 17;
+const byte A4 = 18;
+const byte A5 = 19;
+
+#endif
@@ -0,0 +1,526 @@
+/*
+ * Live incremental analytics for the serial event stream of a running session
+ *   Tails a serial device, pty or stdin and keeps rolling behavior metrics that are updated
+ *   once per decoded event with constant memory, the terminal view is redrawn at a fixed rate
+ *   independent of the event rate.
+ *
+ * Build : g++ -std=c++17 -O2 -o live_metrics host/live_metrics.cpp
+ * Usage : live_metrics <device|-> [-b baud] [-r refresh Hz] [-w rolling window s]
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdarg>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <string>
+
+#include "event_stream.h"
+
+const uint32_t TICKS_PER_SECOND = TIME_IN_MICROSECONDS ? 1000000UL : 1000UL;
+const size_t ROLLING_BUCKETS = 60;
+const size_t READ_CHUNK = 64 * 1024;
+const int MAX_READS_PER_WAKE = 16;   // bounds time spent draining before the view is checked for refresh
+
+static volatile sig_atomic_t stopRequested = 0;
+
+struct RollingCounter
+{
+  uint64_t bucketTicks;
+  uint64_t head;
+  uint64_t total;
+  uint32_t counts[ROLLING_BUCKETS];
+};
+
+struct RunningStat
+{
+  uint64_t n;
+  double mean;
+  double m2;
+  double min;
+  double max;
+  double last;
+};
+
+struct SessionMetrics
+{
+  bool running;
+  bool haveTime;
+  uint32_t tLastRaw;
+  uint64_t now;
+  uint64_t tSessionStart;
+  uint64_t tSessionEnd;
+  uint64_t sessions;
+  int lastSide;
+  bool left[2];
+  bool rewardedVisit[2];
+  uint64_t tLeave[2];
+  uint64_t laps;
+  uint64_t rewards[2];
+  uint64_t touches[2];
+  uint64_t touchesWithoutReward[2];
+  uint64_t events;
+  bool haveIdle;
+  uint32_t idle[IDLE_REPORT_FIELDS];
+  RollingCounter lapRate;
+  RollingCounter rewardRate[2];
+  RunningStat traversal[2];   // indexed by destination side, traversal[SIDE_B] is A->B
+};
+
+void initRollingCounter(RollingCounter &counter, uint64_t window)
+{
+  /*
+  Initialize a bucketed rolling counter
+  <RollingCounter> counter : rolling counter
+  <uint64_t> window : rolling window length in device ticks, split into ROLLING_BUCKETS buckets
+  */
+  counter.bucketTicks = window / ROLLING_BUCKETS > 0 ? window / ROLLING_BUCKETS : 1;
+  counter.head = 0;
+  counter.total = 0;
+  memset(counter.counts, 0, sizeof(counter.counts));
+}
+
+void advanceRollingCounter(RollingCounter &counter, uint64_t tNow)
+{
+  /*
+  Expire buckets that fell out of the window, amortized O(1) per call
+  <RollingCounter> counter : rolling counter
+  <uint64_t> tNow : current session clock
+  */
+  uint64_t idx = tNow / counter.bucketTicks;
+  if (idx <= counter.head)
+  {
+    return;
+  }
+  if (idx - counter.head >= ROLLING_BUCKETS)
+  {
+    memset(counter.counts, 0, sizeof(counter.counts));
+    counter.total = 0;
+  }
+  else
+  {
+    for (uint64_t i = counter.head + 1; i <= idx; i++)
+    {
+      counter.total -= counter.counts[i % ROLLING_BUCKETS];
+      counter.counts[i % ROLLING_BUCKETS] = 0;
+    }
+  }
+  counter.head = idx;
+}
+
+void addRollingCounter(RollingCounter &counter, uint64_t tNow)
+{
+  advanceRollingCounter(counter, tNow);
+  counter.counts[counter.head % ROLLING_BUCKETS]++;
+  counter.total++;
+}
+
+double rollingRatePerMinute(RollingCounter &counter, uint64_t tNow, uint64_t elapsed)
+{
+  /*
+  <RollingCounter> counter : rolling counter
+  <uint64_t> tNow : current session clock
+  <uint64_t> elapsed : session time so far, the rate is normalized over the shorter of window and elapsed
+
+  Returns:
+  <double> : events per minute within the rolling window
+  */
+  advanceRollingCounter(counter, tNow);
+  uint64_t span = counter.bucketTicks * ROLLING_BUCKETS;
+  if (elapsed < span)
+  {
+    span = elapsed;
+  }
+  if (span == 0)
+  {
+    return 0.0;
+  }
+  return 60.0 * TICKS_PER_SECOND * counter.total / span;
+}
+
+void initRunningStat(RunningStat &stat)
+{
+  stat.n = 0;
+  stat.mean = 0.0;
+  stat.m2 = 0.0;
+  stat.min = 0.0;
+  stat.max = 0.0;
+  stat.last = 0.0;
+}
+
+void addRunningStat(RunningStat &stat, double v)
+{
+  /*
+  Welford update of running mean and variance
+  */
+  stat.n++;
+  double d = v - stat.mean;
+  stat.mean += d / stat.n;
+  stat.m2 += d * (v - stat.mean);
+  stat.min = (stat.n == 1 || v < stat.min) ? v : stat.min;
+  stat.max = (stat.n == 1 || v > stat.max) ? v : stat.max;
+  stat.last = v;
+}
+
+void resetSession(SessionMetrics &metrics, uint64_t window)
+{
+  /*
+  Clear all per-session metrics, the device clock is kept
+  <SessionMetrics> metrics : metrics state
+  <uint64_t> window : rolling window length in device ticks
+  */
+  metrics.tSessionStart = metrics.now;
+  metrics.tSessionEnd = metrics.now;
+  metrics.lastSide = -1;
+  metrics.laps = 0;
+  metrics.events = 0;
+  initRollingCounter(metrics.lapRate, window);
+  for (int s = 0; s < 2; s++)
+  {
+    metrics.left[s] = false;
+    metrics.rewardedVisit[s] = false;
+    metrics.tLeave[s] = 0;
+    metrics.rewards[s] = 0;
+    metrics.touches[s] = 0;
+    metrics.touchesWithoutReward[s] = 0;
+    initRollingCounter(metrics.rewardRate[s], window);
+    initRunningStat(metrics.traversal[s]);
+  }
+}
+
+void initSessionMetrics(SessionMetrics &metrics, uint64_t window)
+{
+  metrics.running = false;
+  metrics.haveTime = false;
+  metrics.tLastRaw = 0;
+  metrics.now = 0;
+  metrics.sessions = 0;
+  metrics.haveIdle = false;
+  resetSession(metrics, window);
+}
+
+void updateClock(SessionMetrics &metrics, uint32_t t)
+{
+  /*
+  Unwrap the 32 bit device time into a monotonic 64 bit session clock
+    micros() overflows after ~70min, the unsigned difference stays valid across the wrap
+  */
+  if (metrics.haveTime)
+  {
+    metrics.now += (uint32_t)(t - metrics.tLastRaw);
+  }
+  else
+  {
+    metrics.now = t;
+    metrics.haveTime = true;
+  }
+  metrics.tLastRaw = t;
+}
+
+void updateMetrics(SessionMetrics &metrics, const StreamLine &line, uint64_t window)
+{
+  /*
+  Incrementally update session metrics with a single decoded line
+  <SessionMetrics> metrics : metrics state
+  <StreamLine> line : decoded stream line
+  <uint64_t> window : rolling window length in device ticks
+  */
+  switch (line.kind)
+  {
+    case LINE_BANNER:
+      // board reset, device time restarts from 0
+      metrics.haveTime = false;
+      metrics.running = false;
+      return;
+    case LINE_START:
+      updateClock(metrics, line.t);
+      resetSession(metrics, window);
+      metrics.running = true;
+      metrics.sessions++;
+      return;
+    case LINE_END:
+      updateClock(metrics, line.t);
+      metrics.running = false;
+      metrics.tSessionEnd = metrics.now;
+      return;
+    case LINE_IDLE:
+      metrics.haveIdle = true;
+      memcpy(metrics.idle, line.idle, sizeof(metrics.idle));
+      return;
+    case LINE_EVENT:
+      break;
+    default:
+      return;
+  }
+
+  updateClock(metrics, line.t);
+  metrics.events++;
+  byte side = line.side;
+  if (line.type == IR && line.state == ON)
+  {
+    if (metrics.lastSide >= 0 && metrics.lastSide != side)
+    {
+      metrics.laps++;
+      addRollingCounter(metrics.lapRate, metrics.now);
+      if (metrics.left[metrics.lastSide])
+      {
+        double dt = (double)(metrics.now - metrics.tLeave[metrics.lastSide]) / TICKS_PER_SECOND;
+        addRunningStat(metrics.traversal[side], dt);
+      }
+    }
+    metrics.lastSide = side;
+    metrics.left[side] = false;
+    metrics.rewardedVisit[side] = false;
+  }
+  else if (line.type == IR && line.state == OFF)
+  {
+    metrics.left[side] = true;
+    metrics.tLeave[side] = metrics.now;
+  }
+  else if (line.type == TOUCH && line.state == ON)
+  {
+    metrics.touches[side]++;
+    if (!metrics.rewardedVisit[side])
+    {
+      metrics.touchesWithoutReward[side]++;
+    }
+  }
+  else if (line.type == SOLENOID && line.state == ON)
+  {
+    metrics.rewards[side]++;
+    metrics.rewardedVisit[side] = true;
+    addRollingCounter(metrics.rewardRate[side], metrics.now);
+  }
+}
+
+void appendf(std::string &out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void appendf(std::string &out, const char* fmt, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, args);
+  va_end(args);
+  if (n > 0)
+  {
+    out.append(buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1);
+  }
+}
+
+void appendTraversal(std::string &out, const char* label, const RunningStat &stat)
+{
+  if (stat.n == 0)
+  {
+    appendf(out, "%-16s n=0\n", label);
+    return;
+  }
+  double sd = stat.n > 1 ? std::sqrt(stat.m2 / (stat.n - 1)) : 0.0;
+  appendf(out, "%-16s n=%-6llu last %7.2fs  mean %7.2fs  sd %6.2fs  min %7.2fs  max %7.2fs\n",
+          label, (unsigned long long)stat.n, stat.last, stat.mean, sd, stat.min, stat.max);
+}
+
+void drawView(SessionMetrics &metrics,
+              const LineDecoder &decoder,
+              const char* source,
+              unsigned long long bytes,
+              double eventsPerSecond,
+              bool ansi)
+{
+  /*
+  Render the current metrics as a single write to stdout
+  */
+  std::string out;
+  out.reserve(2048);
+  if (ansi)
+  {
+    out += "\x1b[H\x1b[2J";
+  }
+  uint64_t tEnd = metrics.running ? metrics.now : metrics.tSessionEnd;
+  uint64_t elapsed = tEnd - metrics.tSessionStart;
+  appendf(out, "Linear track live metrics  [%s]  mode %s\n", source, OPERATION_MODE ? "Mode_B" : "Mode_A");
+  appendf(out, "Session %llu: %s  elapsed %.1fs  device t=%lu\n",
+          (unsigned long long)metrics.sessions,
+          metrics.running ? "RUNNING" : (metrics.sessions ? "ended" : "waiting for S"),
+          (double)elapsed / TICKS_PER_SECOND, (unsigned long)metrics.tLastRaw);
+  out += "\n";
+  appendf(out, "%-16s total %-6llu rolling %6.2f /min\n", "Laps",
+          (unsigned long long)metrics.laps, rollingRatePerMinute(metrics.lapRate, tEnd, elapsed));
+  appendf(out, "%-16s total %-6llu rolling %6.2f /min\n", "Rewards A",
+          (unsigned long long)metrics.rewards[SIDE_A], rollingRatePerMinute(metrics.rewardRate[SIDE_A], tEnd, elapsed));
+  appendf(out, "%-16s total %-6llu rolling %6.2f /min\n", "Rewards B",
+          (unsigned long long)metrics.rewards[SIDE_B], rollingRatePerMinute(metrics.rewardRate[SIDE_B], tEnd, elapsed));
+  appendTraversal(out, "Traversal A->B", metrics.traversal[SIDE_B]);
+  appendTraversal(out, "Traversal B->A", metrics.traversal[SIDE_A]);
+  appendf(out, "%-16s A %llu/%llu touches  B %llu/%llu touches\n", "Touch no reward",
+          (unsigned long long)metrics.touchesWithoutReward[SIDE_A], (unsigned long long)metrics.touches[SIDE_A],
+          (unsigned long long)metrics.touchesWithoutReward[SIDE_B], (unsigned long long)metrics.touches[SIDE_B]);
+  if (metrics.haveIdle)
+  {
+    unsigned long limit = MIN_IR_BREAK * (TIME_IN_MICROSECONDS ? 1UL : 1000UL);
+    appendf(out, "%-16s awake %5.1f%%  wakes %lu (%lu on edge)  latency mean %luus max %luus (MIN_IR_BREAK %luus)%s\n", "Idle",
+            metrics.idle[0] / 10.0, (unsigned long)metrics.idle[1], (unsigned long)metrics.idle[2],
+            (unsigned long)metrics.idle[3], (unsigned long)metrics.idle[4], limit,
+            metrics.idle[4] >= limit ? "  EXCEEDED" : "");
+  }
+  out += "\n";
+  appendf(out, "Stream: %llu bytes  %llu lines  %llu unparsed  %.0f events/s\n",
+          bytes, decoder.lines, decoder.badLines, eventsPerSecond);
+  if (!ansi)
+  {
+    out += "----\n";
+  }
+  fwrite(out.data(), 1, out.size(), stdout);
+  fflush(stdout);
+}
+
+void onSignal(int)
+{
+  stopRequested = 1;
+}
+
+void usage(const char* prog)
+{
+  fprintf(stderr, "Usage: %s <device|-> [-b baud] [-r refresh Hz] [-w rolling window s]\n", prog);
+}
+
+int main(int argc, char** argv)
+{
+  const char* source = nullptr;
+  unsigned long baud = BAUD_RATE;
+  double refreshHz = 4.0;
+  double windowSeconds = 60.0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+    {
+      baud = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+    {
+      refreshHz = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+    {
+      windowSeconds = atof(argv[++i]);
+    }
+    else if (source == nullptr && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0))
+    {
+      source = argv[i];
+    }
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (source == nullptr || refreshHz <= 0.0 || windowSeconds <= 0.0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  int fd;
+  int stdinFlags = -1;
+  if (strcmp(source, "-") == 0)
+  {
+    // the file description is shared with the parent shell/pipe, its flags are restored on exit
+    fd = STDIN_FILENO;
+    stdinFlags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, stdinFlags | O_NONBLOCK);
+  }
+  else
+  {
+    fd = openSerialDevice(source, baud);
+    if (fd < 0)
+    {
+      fprintf(stderr, "%s: cannot open %s: %s\n", argv[0], source, strerror(errno));
+      return 1;
+    }
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  uint64_t window = (uint64_t)(windowSeconds * TICKS_PER_SECOND);
+  SessionMetrics metrics;
+  initSessionMetrics(metrics, window);
+  LineDecoder decoder;
+  initLineDecoder(decoder);
+  bool ansi = isatty(STDOUT_FILENO);
+
+  static char chunk[READ_CHUNK];
+  unsigned long long bytes = 0;
+  unsigned long long events = 0;
+  unsigned long long eventsAtLastDraw = 0;
+  uint64_t period = (uint64_t)(1e9 / refreshHz);
+  uint64_t tLastDraw = monotonicNs();
+  uint64_t tNextDraw = tLastDraw + period;
+  bool eof = false;
+  auto onLine = [&](const StreamLine &line)
+  {
+    events += line.kind == LINE_EVENT;
+    updateMetrics(metrics, line, window);
+  };
+
+  while (!eof && !stopRequested)
+  {
+    uint64_t tHost = monotonicNs();
+    int timeout = tNextDraw > tHost ? (int)((tNextDraw - tHost + 999999) / 1000000) : 0;
+    pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno != EINTR)
+    {
+      perror("poll");
+      break;
+    }
+    if (ready > 0)
+    {
+      for (int i = 0; i < MAX_READS_PER_WAKE; i++)
+      {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n > 0)
+        {
+          bytes += n;
+          decodeStream(decoder, chunk, (size_t)n, onLine);
+          continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+          break;
+        }
+        // n == 0 or EIO : writer closed the device or pty
+        eof = true;
+        break;
+      }
+    }
+
+    tHost = monotonicNs();
+    if (tHost >= tNextDraw || eof || stopRequested)
+    {
+      double eventsPerSecond = (events - eventsAtLastDraw) * 1e9 / (double)(tHost - tLastDraw + 1);
+      drawView(metrics, decoder, source, bytes, eventsPerSecond, ansi);
+      eventsAtLastDraw = events;
+      tLastDraw = tHost;
+      // frames missed while draining are skipped rather than drawn back to back
+      tNextDraw += period;
+      if (tNextDraw <= tHost)
+      {
+        tNextDraw = tHost + period;
+      }
+    }
+  }
+
+  if (fd != STDIN_FILENO)
+  {
+    close(fd);
+  }
+  else if (stdinFlags != -1)
+  {
+    fcntl(fd, F_SETFL, stdinFlags);
+  }
+  return 0;
+}
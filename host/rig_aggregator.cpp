@@ -0,0 +1,796 @@
+/*
+ * Multi-rig aggregator for the serial event streams of several boards
+ *   All serial devices are multiplexed with epoll on a single thread, every rig's stream is decoded
+ *   into an append-only binary store <outdir>/rig<ID>.ltr of fixed size records tagged with the
+ *   rig ID and the host receive time.
+ *
+ * Build : g++ -std=c++17 -O2 -pthread -o rig_aggregator host/rig_aggregator.cpp
+ * Usage : rig_aggregator -o <outdir> [-b baud] <ID>=<device> [<ID>=<device> ...]
+ *         rig_aggregator -o <outdir> --loadtest <rigs> [--rate events/s per rig] [--seconds s]
+ *         rig_aggregator --dump <rig store>
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "event_stream.h"
+
+const char STORE_MAGIC[4] = {'L', 'T', 'R', 'R'};
+const uint32_t STORE_VERSION = 1;
+const size_t RECORD_BATCH = 256;                 // records buffered per rig before they are appended
+const int FLUSH_INTERVAL_MS = 200;               // upper bound on time records stay buffered
+const uint64_t REOPEN_INTERVAL_NS = 1000000000ULL;
+const uint64_t LOADTEST_DRAIN_NS = 5000000000ULL;   // wait for in-flight bytes after the writer finished
+const size_t READ_CHUNK = 64 * 1024;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+/*
+ * Store layout: StoreHeader once at file creation followed by RigRecord entries, host byte order
+ * record kinds are fixed on disk, independent of LineKind, bump STORE_VERSION whenever they or RigRecord change
+ */
+enum StoreKind
+{
+  STORE_EVENT = 0,
+  STORE_START = 1,
+  STORE_END = 2,
+  STORE_IDLE = 3,
+  STORE_BANNER = 4,
+};
+
+struct StoreHeader
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t recordSize;
+  uint32_t reserved;
+};
+
+struct RigRecord
+{
+  uint64_t tHost;   // host receive time, CLOCK_REALTIME in ns
+  uint32_t t;       // device time as logged, ms or us depending on TIME_IN_MICROSECONDS, 0 for STORE_IDLE/STORE_BANNER
+  uint16_t rig;
+  uint8_t kind;     // StoreKind
+  uint8_t side;
+  uint8_t type;
+  uint8_t state;
+  uint8_t reserved[2];
+  uint32_t idle[IDLE_REPORT_FIELDS];   // STORE_IDLE only, fields of the I line as logged by updateIdle()
+};
+
+static_assert(sizeof(RigRecord) == 40, "RigRecord layout changed, bump STORE_VERSION");
+
+struct Rig
+{
+  uint16_t id;
+  std::string device;
+  int fd;
+  int storeFd;
+  bool connected;
+  bool storeFailed;
+  uint64_t tRetry;
+  LineDecoder decoder;
+  std::vector<RigRecord> pending;
+  unsigned long long bytes;
+  unsigned long long records;
+  std::atomic<unsigned long long>* received;   // load test only, bytes seen so far
+};
+
+struct LoadTest
+{
+  int rigs;
+  double rate;
+  double seconds;
+  std::vector<int> masters;
+  std::vector<std::string> slaves;
+  std::vector<std::atomic<unsigned long long>> sent;
+  std::vector<std::atomic<unsigned long long>> dropped;
+  std::vector<std::atomic<unsigned long long>> received;
+  std::vector<unsigned long long> events;
+  std::atomic<bool> done;
+};
+
+uint64_t realtimeNs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+bool writeAll(int fd, const void* data, size_t n)
+{
+  const char* p = (const char*)data;
+  while (n > 0)
+  {
+    ssize_t w = write(fd, p, n);
+    if (w < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    p += w;
+    n -= w;
+  }
+  return true;
+}
+
+int openStore(const std::string &dir, uint16_t id)
+{
+  /*
+  Open or create the append-only store of a rig, the header is written only when the file is new
+  <std::string> dir : output directory
+  <uint16_t> id : rig ID
+
+  Returns:
+  <int> : file descriptor, -1 on failure
+  */
+  std::string path = dir + "/rig" + std::to_string(id) + ".ltr";
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "cannot open store %s: %s\n", path.c_str(), strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    // appending must not mix record layouts
+    StoreHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != STORE_VERSION || header.recordSize != sizeof(RigRecord))
+    {
+      fprintf(stderr, "store %s exists with a different format, move it away first\n", path.c_str());
+      close(fd);
+      return -1;
+    }
+  }
+  else
+  {
+    StoreHeader header;
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.recordSize = sizeof(RigRecord);
+    header.reserved = 0;
+    if (!writeAll(fd, &header, sizeof(header)))
+    {
+      fprintf(stderr, "cannot write store %s: %s\n", path.c_str(), strerror(errno));
+      close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+void flushRig(Rig &rig)
+{
+  /*
+  Append buffered records to the rig store
+    A failed write stops the aggregator, the batch is kept and not counted since a partial append
+    cannot be told apart from stored records when retried.
+  */
+  if (rig.pending.empty() || rig.storeFailed)
+  {
+    return;
+  }
+  if (!writeAll(rig.storeFd, rig.pending.data(), rig.pending.size() * sizeof(RigRecord)))
+  {
+    fprintf(stderr, "rig %u: store write failed: %s, %zu records not stored, stopping\n",
+            rig.id, strerror(errno), rig.pending.size());
+    rig.storeFailed = true;
+    stopRequested = 1;
+    return;
+  }
+  rig.records += rig.pending.size();
+  rig.pending.clear();
+}
+
+bool connectRig(Rig &rig, int epfd, size_t index, unsigned long baud)
+{
+  /*
+  Open the serial device of a rig and register it with epoll
+  <Rig> rig : rig state
+  <int> epfd : epoll instance
+  <size_t> index : rig index stored as epoll user data
+  <unsigned long> baud : line rate
+  */
+  rig.fd = openSerialDevice(rig.device.c_str(), baud);
+  if (rig.fd < 0)
+  {
+    return false;
+  }
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = index;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, rig.fd, &ev) != 0)
+  {
+    close(rig.fd);
+    rig.fd = -1;
+    return false;
+  }
+  rig.connected = true;
+  // a partial line from before a reconnect is not continued
+  initLineDecoder(rig.decoder);
+  return true;
+}
+
+void disconnectRig(Rig &rig, int epfd)
+{
+  epoll_ctl(epfd, EPOLL_CTL_DEL, rig.fd, nullptr);
+  close(rig.fd);
+  rig.fd = -1;
+  rig.connected = false;
+  rig.tRetry = monotonicNs() + REOPEN_INTERVAL_NS;
+  flushRig(rig);
+}
+
+bool drainRig(Rig &rig, char* chunk, size_t chunkSize)
+{
+  /*
+  Read everything currently buffered for a rig and decode it into store records
+  <Rig> rig : rig state
+  <char*> chunk : scratch read buffer
+
+  Returns:
+  <bool> : false if the device hung up
+  */
+  while (true)
+  {
+    ssize_t n = read(rig.fd, chunk, chunkSize);
+    if (n > 0)
+    {
+      uint64_t tHost = realtimeNs();
+      rig.bytes += n;
+      if (rig.received != nullptr)
+      {
+        rig.received->fetch_add(n, std::memory_order_relaxed);
+      }
+      decodeStream(rig.decoder, chunk, (size_t)n, [&](const StreamLine &line)
+      {
+        RigRecord record;
+        memset(&record, 0, sizeof(record));
+        record.tHost = tHost;
+        record.rig = rig.id;
+        switch (line.kind)
+        {
+          case LINE_EVENT:
+            record.kind = STORE_EVENT;
+            record.t = line.t;
+            record.side = line.side;
+            record.type = line.type;
+            record.state = line.state;
+            break;
+          case LINE_START:
+            record.kind = STORE_START;
+            record.t = line.t;
+            break;
+          case LINE_END:
+            record.kind = STORE_END;
+            record.t = line.t;
+            break;
+          case LINE_IDLE:
+            record.kind = STORE_IDLE;
+            memcpy(record.idle, line.idle, sizeof(record.idle));
+            break;
+          case LINE_BANNER:
+            record.kind = STORE_BANNER;
+            break;
+          default:
+            // raw trace lines are replayed from the serial log with trace_replay, unparsed lines are counted by the decoder
+            return;
+        }
+        rig.pending.push_back(record);
+        if (rig.pending.size() >= RECORD_BATCH)
+        {
+          flushRig(rig);
+        }
+      });
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    {
+      return true;
+    }
+    // n == 0 or EIO : device unplugged or pty closed
+    return false;
+  }
+}
+
+void loadTestWriter(LoadTest &test)
+{
+  /*
+  Emulate the boards: write synthetic eventLog streams to every pty master at a fixed rate
+    Masters are non-blocking like a UART that cannot wait for the host, bytes that do not fit
+    into the pty buffer are counted as dropped.
+  */
+  char line[STREAM_LINE_MAX];
+  uint64_t tStart = monotonicNs();
+  uint64_t total = (uint64_t)(test.rate * test.seconds);
+  std::vector<uint64_t> next(test.rigs, 0);
+  for (int r = 0; r < test.rigs; r++)
+  {
+    int len = snprintf(line, sizeof(line), "S%u\r\nI1000,0,0,0,0\r\n", 1000U);
+    ssize_t w = write(test.masters[r], line, len);
+    test.sent[r] += w > 0 ? w : 0;
+    test.dropped[r] += w == len ? 0 : len - (w > 0 ? w : 0);
+  }
+  bool remaining = true;
+  while (remaining && !stopRequested)
+  {
+    double elapsed = (monotonicNs() - tStart) / 1e9;
+    uint64_t due = (uint64_t)(elapsed * test.rate);
+    if (due > total)
+    {
+      due = total;
+    }
+    remaining = false;
+    for (int r = 0; r < test.rigs; r++)
+    {
+      for (; next[r] < due; next[r]++)
+      {
+        uint64_t i = next[r];
+        int len = snprintf(line, sizeof(line), "%u%u%u%lu\r\n",
+                           (unsigned)((i / 6) % 2), (unsigned)(i % 3), (unsigned)((i / 3) % 2),
+                           (unsigned long)(1001 + i));
+        ssize_t w = write(test.masters[r], line, len);
+        test.sent[r] += w > 0 ? w : 0;
+        test.dropped[r] += w == len ? 0 : len - (w > 0 ? w : 0);
+        test.events[r]++;
+      }
+      remaining = remaining || next[r] < total;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  for (int r = 0; r < test.rigs; r++)
+  {
+    int len = snprintf(line, sizeof(line), "E%lu\r\n", (unsigned long)(1001 + total));
+    ssize_t w = write(test.masters[r], line, len);
+    test.sent[r] += w > 0 ? w : 0;
+    test.dropped[r] += w == len ? 0 : len - (w > 0 ? w : 0);
+  }
+  test.done = true;
+}
+
+bool openLoadTestPtys(LoadTest &test)
+{
+  for (int r = 0; r < test.rigs; r++)
+  {
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+      fprintf(stderr, "cannot allocate pty %d: %s\n", r, strerror(errno));
+      return false;
+    }
+    test.masters.push_back(master);
+    test.slaves.push_back(ptsname(master));
+  }
+  return true;
+}
+
+bool verifyStore(const std::string &dir, uint16_t id, unsigned long long events)
+{
+  /*
+  Check that a load test store holds S, the idle report, all events with contiguous device time, and E
+  */
+  std::string path = dir + "/rig" + std::to_string(id) + ".ltr";
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr)
+  {
+    return false;
+  }
+  StoreHeader header;
+  RigRecord record;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 && memcmp(header.magic, STORE_MAGIC, 4) == 0;
+  unsigned long long n = 0;
+  bool idle = false;
+  bool started = false;
+  bool ended = false;
+  while (ok && fread(&record, sizeof(record), 1, f) == 1)
+  {
+    if (record.rig != id)
+    {
+      ok = false;
+    }
+    else if (record.kind == STORE_START)
+    {
+      started = true;
+    }
+    else if (record.kind == STORE_IDLE)
+    {
+      idle = started && record.idle[0] == 1000;
+    }
+    else if (record.kind == STORE_END)
+    {
+      ended = true;
+    }
+    else if (record.kind == STORE_EVENT)
+    {
+      ok = started && !ended && record.t == 1001 + n;
+      n++;
+    }
+  }
+  fclose(f);
+  return ok && started && idle && ended && n == events;
+}
+
+void dumpStore(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+    return;
+  }
+  StoreHeader header;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, STORE_MAGIC, 4) != 0 ||
+      header.version != STORE_VERSION || header.recordSize != sizeof(RigRecord))
+  {
+    fprintf(stderr, "%s: not a rig store\n", path);
+    fclose(f);
+    return;
+  }
+  RigRecord record;
+  while (fread(&record, sizeof(record), 1, f) == 1)
+  {
+    printf("%u %llu.%09llu ", record.rig,
+           (unsigned long long)(record.tHost / 1000000000ULL), (unsigned long long)(record.tHost % 1000000000ULL));
+    switch (record.kind)
+    {
+      case STORE_EVENT: printf("%u%u%u%u\n", record.side, record.type, record.state, record.t); break;
+      case STORE_START: printf("S%u\n", record.t); break;
+      case STORE_END: printf("E%u\n", record.t); break;
+      case STORE_IDLE:
+        printf("I%u,%u,%u,%u,%u\n", record.idle[0], record.idle[1], record.idle[2], record.idle[3], record.idle[4]);
+        break;
+      case STORE_BANNER: printf("reset\n"); break;
+      default: printf("unknown kind %u\n", record.kind); break;
+    }
+  }
+  fclose(f);
+}
+
+bool parseRigId(const std::string &s, uint16_t &id)
+{
+  /*
+  <std::string> s : decimal rig ID
+  <uint16_t> id : parsed rig ID
+
+  Returns:
+  <bool> : false unless s holds only digits within 0-65535
+  */
+  if (s.empty() || s.size() > 5 || s.find_first_not_of("0123456789") != std::string::npos)
+  {
+    return false;
+  }
+  unsigned long v = strtoul(s.c_str(), nullptr, 10);
+  if (v > UINT16_MAX)
+  {
+    return false;
+  }
+  id = (uint16_t)v;
+  return true;
+}
+
+bool isEmptyDirectory(const std::string &dir)
+{
+  /*
+  Returns:
+  <bool> : true if dir does not exist yet (it is created) or holds no entries
+  */
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr)
+  {
+    return errno == ENOENT && mkdir(dir.c_str(), 0755) == 0;
+  }
+  bool empty = true;
+  while (dirent* entry = readdir(d))
+  {
+    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+    {
+      empty = false;
+      break;
+    }
+  }
+  closedir(d);
+  return empty;
+}
+
+void onSignal(int)
+{
+  stopRequested = 1;
+}
+
+void usage(const char* prog)
+{
+  fprintf(stderr,
+          "Usage: %s -o <outdir> [-b baud] <ID>=<device> [<ID>=<device> ...]\n"
+          "       %s -o <outdir> --loadtest <rigs> [--rate events/s per rig] [--seconds s]\n"
+          "       %s --dump <rig store>\n", prog, prog, prog);
+}
+
+int main(int argc, char** argv)
+{
+  std::string outdir;
+  unsigned long baud = BAUD_RATE;
+  int loadRigs = 0;
+  double loadRate = 1000.0;
+  double loadSeconds = 10.0;
+  std::vector<Rig> rigs;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--dump" && i + 1 < argc)
+    {
+      dumpStore(argv[++i]);
+      return 0;
+    }
+    else if (arg == "-o" && i + 1 < argc)
+    {
+      outdir = argv[++i];
+    }
+    else if (arg == "-b" && i + 1 < argc)
+    {
+      baud = strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "--loadtest" && i + 1 < argc)
+    {
+      loadRigs = atoi(argv[++i]);
+    }
+    else if (arg == "--rate" && i + 1 < argc)
+    {
+      loadRate = atof(argv[++i]);
+    }
+    else if (arg == "--seconds" && i + 1 < argc)
+    {
+      loadSeconds = atof(argv[++i]);
+    }
+    else if (arg.find('=') != std::string::npos && arg[0] != '-')
+    {
+      std::string id = arg.substr(0, arg.find('='));
+      Rig rig;
+      rig.device = arg.substr(arg.find('=') + 1);
+      if (!parseRigId(id, rig.id) || rig.device.empty())
+      {
+        fprintf(stderr, "invalid rig %s, expected <ID>=<device> with ID 0-65535\n", arg.c_str());
+        usage(argv[0]);
+        return 2;
+      }
+      for (const Rig &other : rigs)
+      {
+        if (other.id == rig.id)
+        {
+          fprintf(stderr, "rig ID %u given twice\n", rig.id);
+          usage(argv[0]);
+          return 2;
+        }
+      }
+      rigs.push_back(std::move(rig));
+    }
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (outdir.empty() || (rigs.empty() == (loadRigs <= 0)) || loadRate <= 0.0 || loadSeconds <= 0.0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // one descriptor per device and store, dozens of rigs exceed small soft limits
+  rlimit lim;
+  if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < lim.rlim_max)
+  {
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  LoadTest test;
+  test.rigs = loadRigs;
+  test.rate = loadRate;
+  test.seconds = loadSeconds;
+  test.done = false;
+  if (loadRigs > 0)
+  {
+    // synthetic records must never be appended to real rig stores, and verification needs fresh stores
+    if (!isEmptyDirectory(outdir))
+    {
+      fprintf(stderr, "load test output directory %s must be new or empty\n", outdir.c_str());
+      return 2;
+    }
+    if (!openLoadTestPtys(test))
+    {
+      return 1;
+    }
+    test.sent = std::vector<std::atomic<unsigned long long>>(loadRigs);
+    test.dropped = std::vector<std::atomic<unsigned long long>>(loadRigs);
+    test.received = std::vector<std::atomic<unsigned long long>>(loadRigs);
+    test.events.assign(loadRigs, 0);
+    for (int r = 0; r < loadRigs; r++)
+    {
+      Rig rig;
+      rig.id = (uint16_t)r;
+      rig.device = test.slaves[r];
+      rigs.push_back(std::move(rig));
+    }
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+  {
+    perror("epoll_create1");
+    return 1;
+  }
+  for (size_t i = 0; i < rigs.size(); i++)
+  {
+    Rig &rig = rigs[i];
+    rig.fd = -1;
+    rig.connected = false;
+    rig.storeFailed = false;
+    rig.tRetry = 0;
+    rig.bytes = 0;
+    rig.records = 0;
+    rig.received = loadRigs > 0 ? &test.received[i] : nullptr;
+    rig.pending.reserve(RECORD_BATCH);
+    initLineDecoder(rig.decoder);
+    rig.storeFd = openStore(outdir, rig.id);
+    if (rig.storeFd < 0)
+    {
+      return 1;
+    }
+    if (!connectRig(rig, epfd, i, baud))
+    {
+      fprintf(stderr, "rig %u: cannot open %s: %s, retrying\n", rig.id, rig.device.c_str(), strerror(errno));
+      rig.tRetry = monotonicNs() + REOPEN_INTERVAL_NS;
+    }
+  }
+
+  std::thread writer;
+  uint64_t tLoadStart = monotonicNs();
+  if (loadRigs > 0)
+  {
+    writer = std::thread(loadTestWriter, std::ref(test));
+  }
+
+  static char chunk[READ_CHUNK];
+  std::vector<epoll_event> events(rigs.size());
+  uint64_t tFlush = monotonicNs();
+  uint64_t tDrain = 0;
+  while (!stopRequested)
+  {
+    int n = epoll_wait(epfd, events.data(), (int)events.size(), FLUSH_INTERVAL_MS);
+    if (n < 0 && errno != EINTR)
+    {
+      perror("epoll_wait");
+      break;
+    }
+    for (int e = 0; e < n; e++)
+    {
+      Rig &rig = rigs[events[e].data.u64];
+      if (!drainRig(rig, chunk, sizeof(chunk)))
+      {
+        fprintf(stderr, "rig %u: %s disconnected\n", rig.id, rig.device.c_str());
+        disconnectRig(rig, epfd);
+      }
+    }
+
+    uint64_t tNow = monotonicNs();
+    if (tNow - tFlush >= FLUSH_INTERVAL_MS * 1000000ULL)
+    {
+      for (Rig &rig : rigs)
+      {
+        flushRig(rig);
+      }
+      tFlush = tNow;
+    }
+
+    if (loadRigs > 0)
+    {
+      // finished once every byte the writer managed to send was received, a hung up pty cannot catch up
+      bool drained = test.done;
+      bool connected = false;
+      for (int r = 0; r < loadRigs; r++)
+      {
+        drained = drained && test.received[r] == test.sent[r];
+        connected = connected || rigs[r].connected;
+      }
+      if (test.done && tDrain == 0)
+      {
+        tDrain = tNow + LOADTEST_DRAIN_NS;
+      }
+      if (drained || !connected || (tDrain != 0 && tNow >= tDrain))
+      {
+        break;
+      }
+      continue;
+    }
+    for (size_t i = 0; i < rigs.size(); i++)
+    {
+      Rig &rig = rigs[i];
+      if (!rig.connected && tNow >= rig.tRetry)
+      {
+        if (connectRig(rig, epfd, i, baud))
+        {
+          fprintf(stderr, "rig %u: %s reconnected\n", rig.id, rig.device.c_str());
+        }
+        else
+        {
+          rig.tRetry = tNow + REOPEN_INTERVAL_NS;
+        }
+      }
+    }
+  }
+
+  stopRequested = 1;
+  if (writer.joinable())
+  {
+    writer.join();
+  }
+  bool storeFailed = false;
+  for (Rig &rig : rigs)
+  {
+    flushRig(rig);
+    storeFailed = storeFailed || rig.storeFailed;
+    if (rig.fd >= 0)
+    {
+      close(rig.fd);
+    }
+    close(rig.storeFd);
+  }
+  close(epfd);
+
+  if (loadRigs <= 0)
+  {
+    for (const Rig &rig : rigs)
+    {
+      fprintf(stderr, "rig %u: %llu bytes, %llu lines, %llu unparsed, %llu records stored%s\n", rig.id,
+              rig.bytes, rig.decoder.lines, rig.decoder.badLines, rig.records, rig.storeFailed ? ", STORE FAILED" : "");
+    }
+    return storeFailed ? 1 : 0;
+  }
+
+  double elapsed = (monotonicNs() - tLoadStart) / 1e9;
+  unsigned long long totalBytes = 0;
+  unsigned long long totalDropped = 0;
+  unsigned long long totalRecords = 0;
+  int failed = 0;
+  for (int r = 0; r < loadRigs; r++)
+  {
+    totalBytes += rigs[r].bytes;
+    totalDropped += test.dropped[r];
+    totalRecords += rigs[r].records;
+    bool ok = test.dropped[r] == 0 && rigs[r].bytes == test.sent[r] && rigs[r].decoder.badLines == 0 &&
+              !rigs[r].storeFailed && verifyStore(outdir, rigs[r].id, test.events[r]);
+    if (!ok)
+    {
+      failed++;
+      fprintf(stderr, "rig %d: sent %llu received %llu dropped %llu bytes, %llu unparsed lines, %llu records - FAILED\n", r,
+              (unsigned long long)test.sent[r], rigs[r].bytes, (unsigned long long)test.dropped[r],
+              rigs[r].decoder.badLines, rigs[r].records);
+    }
+    close(test.masters[r]);
+  }
+  printf("load test: %d rigs, %.0f events/s per rig, %.1fs\n", loadRigs, loadRate, elapsed);
+  printf("  %llu bytes, %llu records received (%.0f KB/s), %llu bytes dropped, %d rigs failed\n",
+         totalBytes, totalRecords, totalBytes / elapsed / 1024.0, totalDropped, failed);
+  return failed == 0 ? 0 : 1;
+}
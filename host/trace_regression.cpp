@@ -0,0 +1,206 @@
+/*
+ * Regression check of the raw input trace against trace_replay
+ *   Simulates the detection part of loop() with random input flicker and loop timing on a millis() clock that
+ *   skips a value every ~42 timer0 overflows like the AVR core, records the raw trace
+ *   with updateRawTrace()/endRawTrace() from helper.h and checks that replayTrace() reproduces every logged
+ *   IR/touch event. Run after changing the trace encoding or the detection code.
+ *   The 32 bit time wrap is not simulated, helper.h computes time in 64 bit on the host.
+ *
+ * Build : g++ -std=c++17 -O2 -o trace_regression host/trace_regression.cpp
+ * Usage : trace_regression [seeds per scenario, default 40]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+#include "trace_replay.h"
+
+const int SIM_ITERATIONS = 50000;
+
+struct Scenario
+{
+  const char* name;
+  int sameTickPercent;    // iterations that stay on the current tick
+  int skipPercent;        // iterations that skip up to skipMax ticks
+  uint32_t skipMax;
+  int flipOdds;           // each input flips with 1/4 chance once every flipOdds iterations
+  uint32_t stallBeforeEnd;  // maximum stall between the last iteration and runtime end
+  bool flipBeforeStall;   // all inputs flip on the last iteration, leaves IR persistence pending during the stall
+  int sessions;           // runtime restarts on input trigger, Z is followed by more records
+  bool overflow;          // serial TX buffer randomly full
+  bool shortAtEnd;        // serial TX buffer short of RAW_TRACE_TX_RESERVE at runtime end
+  size_t maxRuns;         // trace records allowed, 0 for no limit
+};
+
+const Scenario SCENARIOS[] =
+{
+  {"flicker", 60, 5, 4, 50, 1, false, 1, false, false, 0},
+  {"slow loop", 0, 3, 8, 2000, 1, false, 1, false, false, 0},
+  {"stall before E", 60, 5, 4, 50, 40, true, 1, false, false, 0},
+  {"input trigger restart", 60, 5, 4, 50, 20, true, 3, false, false, 0},
+  {"TX buffer full", 60, 5, 4, 50, 1, false, 1, true, false, 0},
+  {"TX buffer short at E", 60, 5, 4, 50, 20, true, 3, false, true, 0},
+  // ~480 millis() skips, each would cost a record if skipped ticks were logged with settled IR
+  {"settled inputs", 60, 0, 1, 20000, 1, false, 1, false, false, 100},
+};
+
+struct Simulation
+{
+  TTLState outputIR;
+  TTLState outputTouch;
+  IRState irDetectorA;
+  IRState irDetectorB;
+  TouchState touchSensorA;
+  TouchState touchSensorB;
+  RawTraceState rawTrace;
+  uint32_t t;
+  byte fract;
+};
+
+void advanceClock(Simulation &sim,
+                  uint32_t overflows)
+{
+  /*
+  Advance the board clock by timer0 overflows, millis() adds 1 per overflow plus the fractional
+  correction of the AVR core (FRACT_INC 3, FRACT_MAX 125), micros() is not modelled beyond +1
+  */
+  for (uint32_t i = 0; i < overflows; i++)
+  {
+    sim.t++;
+    if (!TIME_IN_MICROSECONDS && (sim.fract += 3) >= 125)
+    {
+      sim.fract -= 125;
+      sim.t++;
+    }
+  }
+}
+
+std::string simulate(const Scenario &scenario,
+                     unsigned seed)
+{
+  /*
+  Run one simulated board boot and return its serial log
+  */
+  std::mt19937 rng(seed);
+  Simulation sim;
+  Serial.out.clear();
+  Serial.room = 63;
+  setPins(0);
+  initTTL(sim.outputIR, OUTPUT_IR, OUTPUT);
+  initTTL(sim.outputTouch, OUTPUT_TOUCH, OUTPUT);
+  initIR(sim.irDetectorA, IR_A_PIN, SIDE_A, IR_A_INDICATOR, &sim.outputIR, TTL_PULSE_PERIOD);
+  initIR(sim.irDetectorB, IR_B_PIN, SIDE_B, IR_B_INDICATOR, &sim.outputIR, TTL_PULSE_PERIOD / 2);
+  initTouch(sim.touchSensorA, TOUCH_A_PIN, SIDE_A, &sim.outputTouch, TTL_PULSE_PERIOD);
+  initTouch(sim.touchSensorB, TOUCH_B_PIN, SIDE_B, &sim.outputTouch, TTL_PULSE_PERIOD / 2);
+  initRawTrace(sim.rawTrace, rawSnapshot(sim.irDetectorA, sim.touchSensorA, sim.irDetectorB, sim.touchSensorB), true);
+
+  sim.t = 4000;
+  sim.fract = 0;
+  for (int session = 0; session < scenario.sessions; session++)
+  {
+    Serial.print('S');
+    Serial.println((unsigned long)sim.t);
+    int iterations = SIM_ITERATIONS / scenario.sessions;
+    for (int i = 0; i < iterations; i++)
+    {
+      int r = rng() % 100;
+      if (r >= scenario.sameTickPercent)
+      {
+        advanceClock(sim, r < scenario.sameTickPercent + scenario.skipPercent ? 1 + rng() % scenario.skipMax : 1);
+      }
+      bool flipAll = scenario.flipBeforeStall && i == iterations - 1;
+      if (flipAll || rng() % scenario.flipOdds == 0)
+      {
+        for (byte pin : {IR_A_PIN, TOUCH_A_PIN, IR_B_PIN, TOUCH_B_PIN})
+        {
+          if (flipAll || rng() % 4 == 0)
+          {
+            digitalWrite(pin, !digitalRead(pin));
+          }
+        }
+      }
+      if (scenario.overflow)
+      {
+        Serial.room = i > SIM_ITERATIONS / 4 && rng() % 100 == 0 ? 10 : 63;
+      }
+      detectIR(sim.irDetectorA, sim.t);
+      detectIR(sim.irDetectorB, sim.t);
+      detectTouch(sim.touchSensorA, sim.t);
+      detectTouch(sim.touchSensorB, sim.t);
+      updateRawTrace(sim.rawTrace, rawSnapshot(sim.irDetectorA, sim.touchSensorA, sim.irDetectorB, sim.touchSensorB),
+                     settledIR(sim.irDetectorA) && settledIR(sim.irDetectorB), sim.t);
+    }
+    // runtime end as in updateRuntime(), after loop() possibly stalled
+    advanceClock(sim, scenario.stallBeforeEnd > 1 ? MIN_IR_BREAK + rng() % scenario.stallBeforeEnd : 1);
+    if (scenario.shortAtEnd)
+    {
+      Serial.room = RAW_TRACE_TX_RESERVE / 2;
+    }
+    endRawTrace(sim.rawTrace);
+    Serial.room = 63;
+    Serial.print('E');
+    Serial.println((unsigned long)sim.t);
+    advanceClock(sim, 1 + rng() % 100);
+  }
+  std::string log = Serial.out;
+  Serial.out.clear();
+  return log;
+}
+
+int main(int argc, char** argv)
+{
+  int seeds = argc > 1 ? atoi(argv[1]) : 40;
+  if (argc > 2 || seeds <= 0)
+  {
+    fprintf(stderr, "Usage: %s [seeds per scenario]\n", argv[0]);
+    return 2;
+  }
+  int failed = 0;
+  for (const Scenario &scenario : SCENARIOS)
+  {
+    int passed = 0;
+    unsigned long long events = 0;
+    unsigned long long runs = 0;
+    for (int seed = 1; seed <= seeds; seed++)
+    {
+      std::string serialLog = simulate(scenario, seed);
+      TraceLog log;
+      initTraceLog(log);
+      decodeTraceLog(log, serialLog.data(), serialLog.size());
+      TraceResult result = {};
+      bool ok = log.haveInit && replayTrace(log, result);
+      // the scenario has to hit the case it is named after, without an overflow every session has to be traced
+      if (scenario.overflow != log.overflow || (!log.overflow && result.compared != log.logged.size()))
+      {
+        ok = false;
+      }
+      if (scenario.maxRuns > 0 && log.runs.size() > scenario.maxRuns)
+      {
+        ok = false;
+      }
+      if (ok)
+      {
+        passed++;
+        events += result.compared;
+        runs += log.runs.size();
+      }
+      else
+      {
+        fprintf(stderr, "%s seed %d: FAILED, %zu of %zu logged / %zu replayed events match, %zu trace runs, overflow %d\n",
+                scenario.name, seed, result.mismatch, result.compared, result.replayed.size(), log.runs.size(),
+                log.overflow);
+      }
+    }
+    printf("%-22s %d/%d seeds, %llu events compared, %llu trace runs\n", scenario.name, passed, seeds, events, runs);
+    failed += seeds - passed;
+  }
+  if (failed > 0)
+  {
+    printf("%d seeds FAILED\n", failed);
+    return 1;
+  }
+  printf("all seeds match\n");
+  return 0;
+}
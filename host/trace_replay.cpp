@@ -0,0 +1,113 @@
+/*
+ * Offline replay of the raw input trace through detectIR()/detectTouch() from helper.h
+ *   Reads a serial log captured with RAW_TRACE enabled, rebuilds every traced loop() iteration from
+ *   the run length encoded records and feeds the raw reads to the detection code compiled for the host.
+ *   The IR/touch events produced by the replay are compared with the events logged by the board,
+ *   a mismatch means the log was not produced by this detection code and config.h.
+ *
+ * Build : g++ -std=c++17 -O2 -o trace_replay host/trace_replay.cpp
+ * Usage : trace_replay <log|-> [-v]
+ *   -v : print every raw trace run and the replayed events
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "trace_replay.h"
+
+void printEvent(const char* label, const StreamLine &line)
+{
+  printf("%s%u%u%u%u\n", label, line.side, line.type, line.state, line.t);
+}
+
+int main(int argc, char** argv)
+{
+  const char* path = nullptr;
+  bool verbose = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+    {
+      verbose = true;
+    }
+    else if (path == nullptr)
+    {
+      path = argv[i];
+    }
+    else
+    {
+      path = nullptr;
+      break;
+    }
+  }
+  if (path == nullptr)
+  {
+    fprintf(stderr, "Usage: %s <log|-> [-v]\n", argv[0]);
+    return 2;
+  }
+  FILE* f = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (f == nullptr)
+  {
+    fprintf(stderr, "%s: cannot open %s: %s\n", argv[0], path, strerror(errno));
+    return 1;
+  }
+
+  // decode the log of one board boot: trace records, trace end and logged detection events
+  TraceLog log;
+  initTraceLog(log);
+  char chunk[64 * 1024];
+  size_t n;
+  while (!log.reset && (n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+  {
+    decodeTraceLog(log, chunk, n);
+  }
+  if (f != stdin)
+  {
+    fclose(f);
+  }
+  if (log.reset)
+  {
+    fprintf(stderr, "board reset within the log, replaying up to the reset only\n");
+  }
+  if (!log.haveInit)
+  {
+    fprintf(stderr, "%s: no raw trace in %s, enable RAW_TRACE under config.h\n", argv[0], path);
+    return 1;
+  }
+  if (log.overflow)
+  {
+    fprintf(stderr, "raw trace overflowed the serial TX buffer at %u, events from then on are not compared\n", log.tClose);
+  }
+  if (log.wrapped)
+  {
+    fprintf(stderr, "raw trace crosses the 32 bit time wrap after %u, events from then on are not compared\n", log.tClose);
+  }
+
+  TraceResult result;
+  bool matches = replayTrace(log, result, verbose);
+  if (verbose)
+  {
+    for (const StreamLine &line : result.replayed)
+    {
+      printEvent("replayed ", line);
+    }
+  }
+  printf("%zu trace runs, %llu loop iterations replayed, %zu logged / %zu replayed IR and touch events\n",
+         log.runs.size(), result.iterations, result.compared, result.replayed.size());
+  if (matches)
+  {
+    printf("replay matches\n");
+    return 0;
+  }
+  printf("replay diverges at event %zu\n", result.mismatch);
+  if (result.mismatch < result.compared)
+  {
+    printEvent("  logged   ", result.logged[result.mismatch]);
+  }
+  if (result.mismatch < result.replayed.size())
+  {
+    printEvent("  replayed ", result.replayed[result.mismatch]);
+  }
+  return 1;
+}
@@ -0,0 +1,283 @@
+/*
+ * Replay of the raw input trace through detectIR()/detectTouch() from helper.h, shared by trace_replay and
+ * trace_regression
+ *   decodeTraceLog() collects the trace records and the logged IR/touch events of one board boot,
+ *   replayTrace() rebuilds every traced loop() iteration and compares the events it produces with the logged ones.
+ *
+ * Time is 32 bit on the board but helper.h computes in the host unsigned long, 64 bit on x86-64/arm64, so the
+ * replay stops where the trace crosses the 32 bit wrap of millis()/micros() (~71 min into a micros trace).
+ */
+
+#ifndef HOST_TRACE_REPLAY
+#define HOST_TRACE_REPLAY
+
+#include <cstdio>
+#include <vector>
+
+#include "arduino_stub.h"
+#include "event_stream.h"
+#include "../helper.h"
+
+struct TraceRun
+{
+  uint32_t t;
+  uint32_t count;
+  uint32_t lag;
+  byte snapshot;
+};
+
+struct TraceLog
+{
+  bool haveInit;
+  bool closed;      // Z/O logged the last traced iteration of the final run
+  bool overflow;    // trace stopped on a full serial TX buffer
+  bool wrapped;     // trace crossed the 32 bit time wrap, records after it are ignored
+  bool reset;       // board reset within the log, lines after it are ignored
+  byte initSnapshot;
+  uint32_t tRecord;
+  uint32_t tClose;
+  std::vector<TraceRun> runs;
+  std::vector<StreamLine> logged;
+  LineDecoder decoder;
+};
+
+struct Replay
+{
+  TTLState outputIR;
+  TTLState outputTouch;
+  IRState irDetectorA;
+  IRState irDetectorB;
+  TouchState touchSensorA;
+  TouchState touchSensorB;
+  LineDecoder decoder;
+  std::vector<StreamLine> events;
+  unsigned long long iterations;
+};
+
+struct TraceResult
+{
+  unsigned long long iterations;
+  size_t compared;    // logged events within the replayed time
+  size_t mismatch;    // index of the first differing event, compared if the replay matches
+  std::vector<StreamLine> logged;
+  std::vector<StreamLine> replayed;
+};
+
+inline bool isDetectionEvent(const StreamLine &line)
+{
+  return line.kind == LINE_EVENT && (line.type == IR || line.type == TOUCH);
+}
+
+inline void initTraceLog(TraceLog &log)
+{
+  log.haveInit = false;
+  log.closed = false;
+  log.overflow = false;
+  log.wrapped = false;
+  log.reset = false;
+  log.initSnapshot = 0;
+  log.tRecord = 0;
+  log.tClose = 0;
+  log.runs.clear();
+  log.logged.clear();
+  initLineDecoder(log.decoder);
+}
+
+inline void decodeTraceLog(TraceLog &log,
+                           const char* data,
+                           size_t n)
+{
+  /*
+  Feed raw bytes of a serial log, collecting trace records, trace end and logged detection events
+  <TraceLog> log : decoded log of one board boot
+  <const char*> data : log bytes
+  <size_t> n : number of log bytes
+  */
+  decodeStream(log.decoder, data, n, [&](const StreamLine &line)
+  {
+    if (log.reset)
+    {
+      return;
+    }
+    switch (line.kind)
+    {
+      case LINE_TRACE_INIT:
+        if (log.haveInit)
+        {
+          log.reset = true;
+          return;
+        }
+        log.haveInit = true;
+        log.initSnapshot = line.snapshot;
+        break;
+      case LINE_TRACE:
+        if (log.overflow || log.wrapped)
+        {
+          break;
+        }
+        if ((uint32_t)(log.tRecord + line.t) < log.tRecord)
+        {
+          // the detection code would not see the wrap on the host, keep what is before it
+          log.wrapped = true;
+          log.closed = true;
+          log.tClose = log.tRecord;
+          break;
+        }
+        log.tRecord += line.t;
+        log.runs.push_back({log.tRecord, line.count, line.lag, line.snapshot});
+        log.closed = false;
+        break;
+      case LINE_TRACE_END:
+      case LINE_TRACE_OVERFLOW:
+        // last traced iteration, Z is followed by more records if the runtime restarts on input trigger
+        if (!log.overflow && !log.wrapped)
+        {
+          log.closed = true;
+          log.overflow = line.kind == LINE_TRACE_OVERFLOW;
+          log.tClose = log.tRecord + line.t;
+        }
+        break;
+      case LINE_EVENT:
+        if (isDetectionEvent(line))
+        {
+          log.logged.push_back(line);
+        }
+        break;
+      default:
+        break;
+    }
+  });
+}
+
+inline void setPins(byte snapshot)
+{
+  /*
+  Drive the stub input pins so that digitalReadCorrected() returns the traced reads
+  <byte> snapshot : bit 0-IR A, 1-touch A, 2-IR B, 3-touch B
+  */
+  digitalWrite(IR_A_PIN, ((snapshot >> 0) & 1) != IR_ACTIVE_LOW);
+  digitalWrite(TOUCH_A_PIN, ((snapshot >> 1) & 1) != TOUCH_ACTIVE_LOW);
+  digitalWrite(IR_B_PIN, ((snapshot >> 2) & 1) != IR_ACTIVE_LOW);
+  digitalWrite(TOUCH_B_PIN, ((snapshot >> 3) & 1) != TOUCH_ACTIVE_LOW);
+}
+
+inline void collectSerial(Replay &replay)
+{
+  decodeStream(replay.decoder, Serial.out.data(), Serial.out.size(), [&](const StreamLine &line)
+  {
+    if (isDetectionEvent(line))
+    {
+      replay.events.push_back(line);
+    }
+  });
+  Serial.out.clear();
+}
+
+inline void initReplay(Replay &replay, byte snapshot)
+{
+  /*
+  Initialize detectors the same way setup() does, starting from the traced initial reads
+  */
+  setPins(snapshot);
+  initTTL(replay.outputIR, OUTPUT_IR, OUTPUT);
+  initTTL(replay.outputTouch, OUTPUT_TOUCH, OUTPUT);
+  initIR(replay.irDetectorA, IR_A_PIN, SIDE_A, IR_A_INDICATOR, &replay.outputIR, TTL_PULSE_PERIOD);
+  initIR(replay.irDetectorB, IR_B_PIN, SIDE_B, IR_B_INDICATOR, &replay.outputIR, TTL_PULSE_PERIOD / 2);
+  initTouch(replay.touchSensorA, TOUCH_A_PIN, SIDE_A, &replay.outputTouch, TTL_PULSE_PERIOD);
+  initTouch(replay.touchSensorB, TOUCH_B_PIN, SIDE_B, &replay.outputTouch, TTL_PULSE_PERIOD / 2);
+  initLineDecoder(replay.decoder);
+  replay.events.clear();
+  replay.iterations = 0;
+  Serial.out.clear();
+}
+
+inline void replayIteration(Replay &replay, uint32_t tNow)
+{
+  /*
+  One loop() iteration of the detection calls, in the order of the sketch
+  */
+  detectIR(replay.irDetectorA, tNow);
+  detectIR(replay.irDetectorB, tNow);
+  detectTouch(replay.touchSensorA, tNow);
+  detectTouch(replay.touchSensorB, tNow);
+  replay.iterations++;
+  collectSerial(replay);
+}
+
+inline bool replayTrace(const TraceLog &log,
+                        TraceResult &result,
+                        bool verbose = false)
+{
+  /*
+  Replay every traced loop() iteration and compare the produced IR/touch events with the logged ones
+  <TraceLog> log : decoded log with a raw trace
+  <TraceResult> result : replay statistics, compared and replayed events
+  <bool> verbose : print every raw trace run
+
+  Returns:
+  <bool> : true if the replay reproduces the logged events within the traced time
+  */
+  Replay replay;
+  initReplay(replay, log.initSnapshot);
+  uint32_t tReplayed = log.tClose;
+  for (size_t r = 0; r < log.runs.size(); r++)
+  {
+    const TraceRun &run = log.runs[r];
+    // last iteration with these reads: just before the next record, or as logged by Z/O for the final run
+    uint32_t tLastIteration = run.t;
+    if (r + 1 < log.runs.size())
+    {
+      tLastIteration = log.runs[r + 1].t - log.runs[r + 1].lag;
+    }
+    else if (log.closed)
+    {
+      tLastIteration = log.tClose;
+    }
+    if (verbose)
+    {
+      printf("R %u..%u IR_A %u TOUCH_A %u IR_B %u TOUCH_B %u x%u\n", run.t, tLastIteration,
+             (run.snapshot >> 0) & 1, (run.snapshot >> 1) & 1, (run.snapshot >> 2) & 1, (run.snapshot >> 3) & 1,
+             run.count);
+    }
+    setPins(run.snapshot);
+    for (uint32_t i = 0; i < run.count; i++)
+    {
+      replayIteration(replay, run.t);
+    }
+    for (uint32_t t = run.t; (int32_t)(tLastIteration - t) > 0;)
+    {
+      replayIteration(replay, ++t);
+    }
+    tReplayed = tLastIteration;
+  }
+
+  // reads after the last traced iteration are unknown, events past it are not compared, after an overflow or
+  // the time wrap the iterations at that tick following the last known one are unknown as well
+  int32_t cutoff = log.overflow || log.wrapped ? 0 : 1;
+  result.logged = log.logged;
+  while (!result.logged.empty() && (int32_t)(result.logged.back().t - tReplayed) >= cutoff)
+  {
+    result.logged.pop_back();
+  }
+  result.replayed = replay.events;
+  while (!result.replayed.empty() && (int32_t)(result.replayed.back().t - tReplayed) >= cutoff)
+  {
+    result.replayed.pop_back();
+  }
+  result.iterations = replay.iterations;
+  result.compared = result.logged.size();
+
+  size_t common = result.compared < result.replayed.size() ? result.compared : result.replayed.size();
+  result.mismatch = 0;
+  while (result.mismatch < common &&
+         result.logged[result.mismatch].side == result.replayed[result.mismatch].side &&
+         result.logged[result.mismatch].type == result.replayed[result.mismatch].type &&
+         result.logged[result.mismatch].state == result.replayed[result.mismatch].state &&
+         result.logged[result.mismatch].t == result.replayed[result.mismatch].t)
+  {
+    result.mismatch++;
+  }
+  return result.mismatch == result.compared && result.mismatch == result.replayed.size();
+}
+
+#endif
@@ -11,6 +11,8 @@ BlinkLEDState ledA;
 IRState irDetectorA, irDetectorB;
 TouchState touchSensorA, touchSensorB;
 SolenoidState solenoidValveA, solenoidValveB;
+IdleState idle;
+RawTraceState rawTrace;
 
 void setup()
 {
@@ -22,7 +24,7 @@ void setup()
   initTTL(outputIR, OUTPUT_IR, OUTPUT);
   initTTL(outputTouch, OUTPUT_TOUCH, OUTPUT);
   initTTL(outputSolenoid, OUTPUT_SOLENOID, OUTPUT);
-  initRuntime(runtime, LED_RUNTIME, &outputTrigger, &inputTrigger);
+  initRuntime(runtime, LED_RUNTIME, &outputTrigger, &inputTrigger, RUN_TIME_DURATION, DELAY_START, &rawTrace);
   initBlinkLED(ledA, LED_BLINK_PIN, SIDE_A);
   initIR(irDetectorA, IR_A_PIN, SIDE_A, IR_A_INDICATOR, &outputIR, TTL_PULSE_PERIOD);
   initIR(irDetectorB, IR_B_PIN, SIDE_B, IR_B_INDICATOR, &outputIR, TTL_PULSE_PERIOD / 2);
@@ -30,6 +32,8 @@ void setup()
   initTouch(touchSensorB, TOUCH_B_PIN, SIDE_B, &outputTouch, TTL_PULSE_PERIOD / 2);
   initSolenoid(solenoidValveA, SOLENOID_A_PIN, SIDE_A, &outputSolenoid, TTL_PULSE_PERIOD);
   initSolenoid(solenoidValveB, SOLENOID_B_PIN, SIDE_B, &outputSolenoid, TTL_PULSE_PERIOD / 2);
+  initIdle(idle);
+  initRawTrace(rawTrace, rawSnapshot(irDetectorA, touchSensorA, irDetectorB, touchSensorB));
   // log
   Serial.print("Linear Track Behaviour in mode: ");
   OPERATION_MODE ? Serial.println("Mode_B") : Serial.println("Mode_A");
@@ -50,6 +54,8 @@ void loop()
     detectIR(irDetectorB, runtime.tNow);
     detectTouch(touchSensorA, runtime.tNow);
     detectTouch(touchSensorB, runtime.tNow);
+    updateRawTrace(rawTrace, rawSnapshot(irDetectorA, touchSensorA, irDetectorB, touchSensorB),
+                   settledIR(irDetectorA) && settledIR(irDetectorB), runtime.tNow);
 
     updateBlinkLED(ledA, runtime.tNow);
     updateSolenoid(solenoidValveA, runtime.tNow);
@@ -85,4 +91,20 @@ void loop()
       lastIR = SIDE_B;
     }
   }
+
+  // sleep until the next edge or timer tick unless an output, a persistance check or a deadline is pending
+  bool busy = outputTrigger.state || outputIR.state || outputTouch.state || outputSolenoid.state ||
+              solenoidValveA.open || solenoidValveB.open ||
+              (runtime.runtimeFlag && !(settledIR(irDetectorA) && settledIR(irDetectorB)));
+  unsigned long tDeadline = -1;
+  if (runtime.runtimeFlag)
+  {
+    tDeadline = min(timeRemaining(runtime.tRuntimeStart, runtime.duration, runtime.tNow),
+                    timeRemaining(ledA.ledBlinkState ? ledA.tLEDon : ledA.tLEDoff, ledA.blinkInterval, runtime.tNow));
+  }
+  else if (runtime.inputTrigger == nullptr)
+  {
+    tDeadline = timeRemaining(runtime.tStart, runtime.delay, runtime.tNow);
+  }
+  updateIdle(idle, runtime.tNow, busy, tDeadline);
 }
\ No newline at end of file